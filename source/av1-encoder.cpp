@@ -23,6 +23,13 @@
 #include <stdexcept>
 #include <vector>
 #include <chrono>
+#include <algorithm>
+
+// Copy threads used by pipelined input, counted against the CPU budget.
+#define PIPELINE_WORKERS			2
+
+// Intra frame size limit in Intra Refresh mode, relative to average frames.
+#define MAX_INTRA_BITRATE_PCT			300
 
 const char * AV1Encoder::get_name(void *) {
 	return P_TRANSLATE(P_NAME);
@@ -37,7 +44,8 @@ void * AV1Encoder::create(obs_data_t *data, obs_encoder_t *encoder) {
 	}
 }
 
-AV1Encoder::AV1Encoder(obs_data_t *data, obs_encoder_t *encoder) : m_self(encoder) {
+AV1Encoder::AV1Encoder(obs_data_t *data, obs_encoder_t *encoder) : m_self(encoder),
+	m_inputStage(obs_data_get_bool(data, P_PIPELINE) ? PIPELINE_WORKERS : 0) {
 	aom_codec_err_t res;
 
 	#pragma region OBS Video Data
@@ -105,7 +113,36 @@ AV1Encoder::AV1Encoder(obs_data_t *data, obs_encoder_t *encoder) : m_self(encode
 		throw std::runtime_error("Failed to get default encoder configuration.");
 	}
 
+	// Weight for the shared CPU budget.
+	m_cpuBudget.weight = uint64_t(obsWidth) * obsHeight * obsFPSnum / obsFPSden;
+	m_cpuBudget.fixed = 0;
+	m_cpuBudget.limit = 0;
+	m_cpuBudget.helpers = obs_data_get_bool(data, P_PIPELINE) ? PIPELINE_WORKERS : 0;
+	m_cpuBudget.threads = 0;
+
+	m_framesSinceKeyframe = 0;
+
 	update(data);
+
+	// Intra Refresh replaces periodic keyframes, which are instead forced
+	// once the maximum keyframe interval has passed. Cyclic refresh is a
+	// real-time CBR tool, so it is only set up at creation.
+	m_intraRefresh = obs_data_get_bool(data, P_INTRAREFRESH);
+	if (m_intraRefresh) {
+		if (m_configuration.rc_end_usage != AOM_CBR) {
+			PLOG_WARNING("Intra Refresh requires CBR, switching Rate Control Mode to CBR.");
+			m_configuration.rc_end_usage = AOM_CBR;
+		}
+		if (m_configuration.g_lag_in_frames != 0) {
+			PLOG_WARNING("Intra Refresh requires no lag, setting Lag (In Frames) to 0.");
+			m_configuration.g_lag_in_frames = 0;
+		}
+		if (m_configuration.g_error_resilient != AOM_ERROR_RESILIENT_DEFAULT) {
+			PLOG_WARNING("Intra Refresh requires error resilience, switching Error Resilience Mode to Default.");
+			m_configuration.g_error_resilient = AOM_ERROR_RESILIENT_DEFAULT;
+		}
+		m_configuration.kf_mode = AOM_KF_DISABLED;
+	}
 	m_configuration.g_timebase.den = obsFPSnum;
 	m_configuration.g_timebase.num = obsFPSden;
 	m_configuration.g_w = obsWidth;
@@ -116,36 +153,71 @@ AV1Encoder::AV1Encoder(obs_data_t *data, obs_encoder_t *encoder) : m_self(encode
 
 	maxencodetime = uint32_t((double_t(obsFPSden) / double_t(obsFPSnum)) * 1000000);
 
-	// Create frame buffer.
-	if (!aom_img_alloc(&m_image, m_imageFormat, obsWidth, obsHeight, 1)) {
-		throw std::runtime_error("Failed to create frame buffer.");
-	} else {
+	// Create frame buffers, one is filled while the other is being encoded.
+	for (size_t idx = 0; idx < 2; idx++) {
+		if (!aom_img_alloc(&m_image[idx], m_imageFormat, obsWidth, obsHeight, 1)) {
+			if (idx > 0)
+				aom_img_free(&m_image[0]);
+			throw std::runtime_error("Failed to create frame buffer.");
+		}
 		switch (voi->range) {
 			case VIDEO_RANGE_PARTIAL:
-				m_image.range = aom_color_range_t::AOM_CR_STUDIO_RANGE;
+				m_image[idx].range = aom_color_range_t::AOM_CR_STUDIO_RANGE;
 				break;
 			default:
-				m_image.range = aom_color_range_t::AOM_CR_FULL_RANGE;
+				m_image[idx].range = aom_color_range_t::AOM_CR_FULL_RANGE;
 				break;
 		}
 		switch (voi->colorspace) {
 			case VIDEO_CS_601:
-				m_image.cs = aom_color_space_t::AOM_CS_BT_601;
+				m_image[idx].cs = aom_color_space_t::AOM_CS_BT_601;
 				break;
 			case VIDEO_CS_DEFAULT:
 			case VIDEO_CS_709:
-				m_image.cs = aom_color_space_t::AOM_CS_BT_709;
+				m_image[idx].cs = aom_color_space_t::AOM_CS_BT_709;
 				break;
 		}
 	}
+	m_imageIndex = 0;
+
+	// Pipelining overlaps the copy of the next frame with the current encode,
+	// at the cost of one frame of latency. OBS does not flush encoders, so
+	// the last submitted frame is never encoded.
+	m_pipelined = obs_data_get_bool(data, P_PIPELINE);
+	m_hasPendingImage = false;
+	m_pendingPts = 0;
+
+	// Join CPU budget, which decides the initial thread count.
+	cpu_budget_join(&m_cpuBudget);
+	m_configuration.g_threads = m_cpuBudget.threads;
 
 	// Initialize
 	res = aom_codec_enc_init(&m_codec, av1enc->codec_interface(), &m_configuration, 0);
 	if (res != AOM_CODEC_OK) {
+		cpu_budget_leave(&m_cpuBudget);
+		aom_img_free(&m_image[0]);
+		aom_img_free(&m_image[1]);
 		std::vector<char> buf(1024);
 		sprintf(buf.data(), "Failed to initialize encoder, code %d.", res);
 		throw std::runtime_error(std::string(buf.data()));
 	}
+	m_appliedConfiguration = m_configuration;
+
+	// Intra Refresh
+	if (m_intraRefresh) {
+		// Cyclic refresh AQ spreads intra blocks over multiple frames.
+		res = aom_codec_control(&m_codec, AV1E_SET_AQ_MODE, 3);
+		if (res != AOM_CODEC_OK) {
+			PLOG_WARNING("Failed to enable cyclic refresh: %s", aom_codec_err_to_string(res));
+		}
+
+		// Limit intra frames to three times the average frame size, the floor
+		// used by the libvpx real-time examples.
+		res = aom_codec_control(&m_codec, AOME_SET_MAX_INTRA_BITRATE_PCT, MAX_INTRA_BITRATE_PCT);
+		if (res != AOM_CODEC_OK) {
+			PLOG_WARNING("Failed to limit intra frame size: %s", aom_codec_err_to_string(res));
+		}
+	}
 
 	PLOG_INFO("Encoder initialized.");
 }
@@ -155,7 +227,9 @@ void AV1Encoder::destroy(void *ptr) {
 }
 
 AV1Encoder::~AV1Encoder() {
-	aom_img_free(&m_image);
+	cpu_budget_leave(&m_cpuBudget);
+	aom_img_free(&m_image[0]);
+	aom_img_free(&m_image[1]);
 }
 
 void AV1Encoder::get_defaults(obs_data_t *data) {
@@ -175,7 +249,8 @@ void AV1Encoder::get_defaults(obs_data_t *data) {
 	}
 
 	obs_data_set_default_int(data, P_USAGE, cfg.g_usage);
-	obs_data_set_default_int(data, P_THREADS, cfg.g_threads);
+	obs_data_set_default_int(data, P_THREADS, 0);
+	obs_data_set_default_int(data, P_THREADS_BUDGET, 0);
 	obs_data_set_default_int(data, P_PROFILE, cfg.g_profile);
 	obs_data_set_default_int(data, P_ERRORRESILIENT, cfg.g_error_resilient);
 	obs_data_set_default_int(data, P_LAGINFRAMES, cfg.g_lag_in_frames);
@@ -197,6 +272,8 @@ void AV1Encoder::get_defaults(obs_data_t *data) {
 	obs_data_set_default_int(data, P_RC_BUFFER_OPTIMALSIZE, cfg.rc_buf_optimal_sz);
 	obs_data_set_default_int(data, P_KF_INTERVAL_MIN, cfg.kf_min_dist);
 	obs_data_set_default_int(data, P_KF_INTERVAL_MAX, cfg.kf_max_dist);
+	obs_data_set_default_bool(data, P_INTRAREFRESH, false);
+	obs_data_set_default_bool(data, P_PIPELINE, false);
 }
 
 obs_properties_t * AV1Encoder::get_properties(void *ptr) {
@@ -211,6 +288,12 @@ obs_properties_t * AV1Encoder::get_properties(void *ptr) {
 	// g_threads
 	p = obs_properties_add_int_slider(pr, P_THREADS, P_TRANSLATE(P_THREADS),
 		0, 16, 1);
+	obs_property_set_long_description(p, P_TRANSLATE_DESCRIPTION(P_THREADS));
+
+	// Shared CPU budget
+	p = obs_properties_add_int_slider(pr, P_THREADS_BUDGET, P_TRANSLATE(P_THREADS_BUDGET),
+		0, 256, 1);
+	obs_property_set_long_description(p, P_TRANSLATE_DESCRIPTION(P_THREADS_BUDGET));
 
 	// g_profile
 	p = obs_properties_add_list(pr, P_PROFILE, P_TRANSLATE(P_PROFILE),
@@ -310,6 +393,14 @@ obs_properties_t * AV1Encoder::get_properties(void *ptr) {
 	p = obs_properties_add_int_slider(pr, P_KF_INTERVAL_MAX, P_TRANSLATE(P_KF_INTERVAL_MAX),
 		0, 9999, 1);
 
+	// Intra Refresh
+	p = obs_properties_add_bool(pr, P_INTRAREFRESH, P_TRANSLATE(P_INTRAREFRESH));
+	obs_property_set_long_description(p, P_TRANSLATE_DESCRIPTION(P_INTRAREFRESH));
+
+	// Pipelined Input
+	p = obs_properties_add_bool(pr, P_PIPELINE, P_TRANSLATE(P_PIPELINE));
+	obs_property_set_long_description(p, P_TRANSLATE_DESCRIPTION(P_PIPELINE));
+
 	// Instance specific settings.
 	if (ptr != nullptr)
 		reinterpret_cast<AV1Encoder*>(ptr)->get_properties(pr);
@@ -325,7 +416,8 @@ bool AV1Encoder::update(void *ptr, obs_data_t *data) {
 
 bool AV1Encoder::update(obs_data_t *data) {
 	m_configuration.g_usage = (unsigned int)obs_data_get_int(data, P_USAGE);
-	m_configuration.g_threads = (unsigned int)obs_data_get_int(data, P_THREADS);
+	cpu_budget_update(&m_cpuBudget, (uint32_t)obs_data_get_int(data, P_THREADS),
+		(uint32_t)obs_data_get_int(data, P_THREADS_BUDGET));
 	m_configuration.g_profile = (unsigned int)obs_data_get_int(data, P_PROFILE);
 	m_configuration.g_error_resilient = (unsigned int)obs_data_get_int(data, P_ERRORRESILIENT);
 	m_configuration.g_lag_in_frames = (unsigned int)obs_data_get_int(data, P_LAGINFRAMES);
@@ -356,20 +448,51 @@ bool AV1Encoder::encode(void *ptr, struct encoder_frame *frame, struct encoder_p
 }
 
 bool AV1Encoder::encode(struct encoder_frame *frame, struct encoder_packet *packet, bool *received_frame) {
-	if (m_imageFormat == AOM_IMG_FMT_ARGB_LE) {
-		std::memcpy(m_image.planes[AOM_PLANE_PACKED], frame->data[0], frame->linesize[0] * m_image.h);
-	} else if (m_imageFormat == AOM_IMG_FMT_I444) {
-		std::memcpy(m_image.planes[AOM_PLANE_Y], frame->data[0], frame->linesize[0] * m_image.h);
-		std::memcpy(m_image.planes[AOM_PLANE_U], frame->data[1], frame->linesize[1] * m_image.h);
-		std::memcpy(m_image.planes[AOM_PLANE_V], frame->data[2], frame->linesize[2] * m_image.h);
-	} else if (m_imageFormat == AOM_IMG_FMT_I420) {
-		std::memcpy(m_image.planes[AOM_PLANE_Y], frame->data[0], frame->linesize[0] * m_image.h);
-		std::memcpy(m_image.planes[AOM_PLANE_U], frame->data[1], frame->linesize[1] * m_image.h / 2);
-		std::memcpy(m_image.planes[AOM_PLANE_V], frame->data[2], frame->linesize[2] * m_image.h / 2);
+	// Apply thread count changes from the shared CPU budget.
+	// Only the thread count changes, other settings stay as initialized.
+	uint32_t threads = m_cpuBudget.threads;
+	if (threads != m_appliedConfiguration.g_threads) {
+		uint32_t oldThreads = m_appliedConfiguration.g_threads;
+		m_appliedConfiguration.g_threads = threads;
+		aom_codec_err_t res = aom_codec_enc_config_set(&m_codec, &m_appliedConfiguration);
+		if (res != AOM_CODEC_OK) {
+			// Retry on the next frame.
+			m_appliedConfiguration.g_threads = oldThreads;
+			PLOG_WARNING("Failed to apply thread count %u: %s", threads, aom_codec_err_to_string(res));
+		} else {
+			PLOG_INFO("Thread count changed to %u.", threads);
+		}
+	}
+
+	// Prepare the input image, copied inline unless pipelined.
+	aom_image_t* image = &m_image[m_imageIndex];
+	int64_t pts = frame->pts;
+	m_inputStage.submit(frame, image);
+	if (m_pipelined) {
+		// Encode the previous frame while the current one is being copied.
+		image = m_hasPendingImage ? &m_image[m_imageIndex ^ 1] : nullptr;
+		std::swap(pts, m_pendingPts);
+		m_hasPendingImage = true;
+		m_imageIndex ^= 1;
+	} else {
+		m_inputStage.wait();
+	}
+
+	if (!image) {
+		m_inputStage.wait();
+		return true;
+	}
+
+	// Force keyframes on demand in Intra Refresh mode.
+	aom_enc_frame_flags_t flags = 0;
+	if (m_intraRefresh && (m_appliedConfiguration.kf_max_dist != 0)
+		&& (m_framesSinceKeyframe >= m_appliedConfiguration.kf_max_dist)) {
+		flags |= AOM_EFLAG_FORCE_KF;
 	}
 
 	// Encode
-	aom_codec_err_t res = aom_codec_encode(&m_codec, &m_image, frame->pts, 1, 0, maxencodetime);
+	aom_codec_err_t res = aom_codec_encode(&m_codec, image, pts, 1, flags, maxencodetime);
+	m_inputStage.wait();
 	if (res != AOM_CODEC_OK) {
 		PLOG_ERROR("Encoding packet failed, code: %lld", res);
 		return false;
@@ -383,11 +506,26 @@ bool AV1Encoder::encode(struct encoder_frame *frame, struct encoder_packet *pack
 
 		if (pkt->kind == AOM_CODEC_CX_FRAME_PKT) {
 			packet->pts = pkt->data.frame.pts;
-			packet->size = pkt->data.frame.sz;
 			packet->keyframe = pkt->data.frame.flags & AOM_FRAME_IS_KEY;
-			packet->data = (uint8_t*)pkt->data.frame.buf;
+			if (m_obu.process((const uint8_t*)pkt->data.frame.buf, pkt->data.frame.sz)) {
+				packet->size = m_obu.get_size();
+				packet->data = (uint8_t*)m_obu.get_data();
+				if (m_obu.has_sequence_header_changed()) {
+					PLOG_INFO("Sequence header changed.");
+				}
+			} else {
+				PLOG_WARNING("Failed to parse packet OBUs, passing it through unmodified.");
+				packet->size = pkt->data.frame.sz;
+				packet->data = (uint8_t*)pkt->data.frame.buf;
+			}
 			packet->dts = packet->pts - pkt->data.frame.duration;
 			*received_frame = true;
+
+			if (packet->keyframe) {
+				m_framesSinceKeyframe = 0;
+			} else {
+				m_framesSinceKeyframe++;
+			}
 		} // ToDo: determine live two-pass encoding, technically possible.
 	}
 
@@ -408,15 +546,24 @@ bool AV1Encoder::get_extra_data(void *ptr, uint8_t **data, size_t *size) {
 }
 
 bool AV1Encoder::get_extra_data(uint8_t **data, size_t *size) {
+	// Use the cached configuration record if a sequence header was seen.
+	if (m_obu.get_extra_data(data, size)) {
+		return true;
+	}
+
 	aom_fixed_buf_t* buf = aom_codec_get_global_headers(&m_codec);
 	if (!buf) {
 		return false;
 	}
 
-	*data = (uint8_t*)buf->buf;
-	*size = buf->sz;
+	// Cache the headers as-is if they can't be parsed.
+	if (!m_obu.set_sequence_header((const uint8_t*)buf->buf, buf->sz)) {
+		m_obu.set_extra_data((const uint8_t*)buf->buf, buf->sz);
+	}
+	free(buf->buf);
+	free(buf);
 
-	return true;
+	return m_obu.get_extra_data(data, size);
 }
 
 void AV1Encoder::get_video_info(void *ptr, struct video_scale_info *vsi) {
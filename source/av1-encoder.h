@@ -18,12 +18,17 @@
  */
 
 #pragma once
+#include "cpu-budget.h"
+#include "obu-processor.h"
+#include "input-stage.h"
+
 extern "C" {
 #pragma warning(push)
 #pragma warning(disable:4201)
 #include "libobs/obs-module.h"
 #include <aom/aom.h>
 #include <aom/aom_encoder.h>
+#include <aom/aomcx.h>
 #pragma warning(pop)
 }
 
@@ -62,9 +67,25 @@ class AV1Encoder {
 
 	//AV1
 	aom_img_fmt m_imageFormat;
-	aom_image_t m_image;
+	aom_image_t m_image[2];
+	size_t m_imageIndex;
 	aom_codec_enc_cfg_t m_configuration;
+	aom_codec_enc_cfg_t m_appliedConfiguration; // Owned by the encode thread.
 	aom_codec_ctx_t m_codec;
+	OBUProcessor m_obu;
+
+	// Intra Refresh
+	bool m_intraRefresh;
+	uint32_t m_framesSinceKeyframe;
+
+	// Threading
+	cpu_budget_client m_cpuBudget;
+
+	// Input
+	InputStage m_inputStage;
+	bool m_pipelined;
+	bool m_hasPendingImage;
+	int64_t m_pendingPts;
 
 	uint32_t width, height;
 	uint32_t maxencodetime;
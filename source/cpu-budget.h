@@ -0,0 +1,43 @@
+/*
+ * AV1 Encoder for Open Broadcaster Software Studio
+ * Copyright (C) 2017 Michael Fabian Dirks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#pragma once
+#include <inttypes.h>
+#include <atomic>
+
+/// Every encoder instance joins the budget on creation and leaves it on
+/// destruction. The available cores are split between all instances by the
+/// amount of pixels they process per second, so that multiple encoders (e.g.
+/// stream and recording) do not oversubscribe the system.
+struct cpu_budget_client {
+	uint64_t weight;		// Pixels per second.
+	uint32_t fixed;			// User-specified thread count, 0 for automatic.
+	uint32_t limit;			// Requested core budget, 0 for all logical cores.
+	uint32_t helpers;		// Threads used outside of libaom, reserve one core.
+	std::atomic<uint32_t> threads;	// Assigned thread count.
+};
+
+void cpu_budget_join(cpu_budget_client *client);
+void cpu_budget_leave(cpu_budget_client *client);
+
+/// Change the requested thread count and core budget of a client.
+///
+/// The effective budget is the smallest non-zero limit requested by any live
+/// client, so an encoder left at the default never widens another's budget.
+void cpu_budget_update(cpu_budget_client *client, uint32_t fixed, uint32_t limit);
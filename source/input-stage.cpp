@@ -0,0 +1,139 @@
+/*
+ * AV1 Encoder for Open Broadcaster Software Studio
+ * Copyright (C) 2017 Michael Fabian Dirks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "input-stage.h"
+#include <algorithm>
+#include <memory.h>
+
+InputStage::InputStage(size_t workers) : m_nextBand(0), m_pendingBands(0), m_shutdown(false) {
+	for (size_t idx = 0; idx < workers; idx++) {
+		m_workers.emplace_back(&InputStage::worker, this);
+	}
+}
+
+InputStage::~InputStage() {
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_shutdown = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& thread : m_workers) {
+		thread.join();
+	}
+}
+
+void InputStage::submit(const struct encoder_frame *frame, aom_image_t *image) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_bands.clear();
+	m_nextBand = 0;
+
+	uint32_t width = image->d_w, height = image->d_h;
+	switch (image->fmt) {
+		case AOM_IMG_FMT_ARGB_LE:
+			add_plane(frame->data[0], frame->linesize[0], image->planes[AOM_PLANE_PACKED],
+				image->stride[AOM_PLANE_PACKED], width * 4, height);
+			break;
+		case AOM_IMG_FMT_YVYU:
+		case AOM_IMG_FMT_YUY2:
+		case AOM_IMG_FMT_UYVY:
+			add_plane(frame->data[0], frame->linesize[0], image->planes[AOM_PLANE_PACKED],
+				image->stride[AOM_PLANE_PACKED], width * 2, height);
+			break;
+		case AOM_IMG_FMT_I420:
+			add_plane(frame->data[0], frame->linesize[0], image->planes[AOM_PLANE_Y],
+				image->stride[AOM_PLANE_Y], width, height);
+			add_plane(frame->data[1], frame->linesize[1], image->planes[AOM_PLANE_U],
+				image->stride[AOM_PLANE_U], (width + 1) / 2, (height + 1) / 2);
+			add_plane(frame->data[2], frame->linesize[2], image->planes[AOM_PLANE_V],
+				image->stride[AOM_PLANE_V], (width + 1) / 2, (height + 1) / 2);
+			break;
+		case AOM_IMG_FMT_I444:
+			add_plane(frame->data[0], frame->linesize[0], image->planes[AOM_PLANE_Y],
+				image->stride[AOM_PLANE_Y], width, height);
+			add_plane(frame->data[1], frame->linesize[1], image->planes[AOM_PLANE_U],
+				image->stride[AOM_PLANE_U], width, height);
+			add_plane(frame->data[2], frame->linesize[2], image->planes[AOM_PLANE_V],
+				image->stride[AOM_PLANE_V], width, height);
+			break;
+		default:
+			break;
+	}
+
+	if (m_workers.empty()) {
+		for (const band& b : m_bands) {
+			copy_band(b);
+		}
+		m_bands.clear();
+		return;
+	}
+
+	m_pendingBands = m_bands.size();
+	lock.unlock();
+	m_wake.notify_all();
+}
+
+void InputStage::wait() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_done.wait(lock, [this] { return m_pendingBands == 0; });
+}
+
+void InputStage::add_plane(const uint8_t *source, uint32_t sourceStride,
+	uint8_t *target, uint32_t targetStride, uint32_t width, uint32_t rows) {
+	// Two bands per worker keeps them busy if one is descheduled.
+	uint32_t bands = std::max(uint32_t(m_workers.size() * 2), 1u);
+	uint32_t bandRows = std::max((rows + bands - 1) / bands, 1u);
+	width = std::min(width, std::min(sourceStride, targetStride));
+
+	for (uint32_t row = 0; row < rows; row += bandRows) {
+		band b;
+		b.source = source + size_t(row) * sourceStride;
+		b.sourceStride = sourceStride;
+		b.target = target + size_t(row) * targetStride;
+		b.targetStride = targetStride;
+		b.width = width;
+		b.rows = std::min(bandRows, rows - row);
+		m_bands.push_back(b);
+	}
+}
+
+void InputStage::copy_band(const band &b) {
+	for (uint32_t row = 0; row < b.rows; row++) {
+		memcpy(b.target + size_t(row) * b.targetStride,
+			b.source + size_t(row) * b.sourceStride, b.width);
+	}
+}
+
+void InputStage::worker() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (true) {
+		m_wake.wait(lock, [this] { return m_shutdown || (m_nextBand < m_bands.size()); });
+		if (m_shutdown)
+			return;
+
+		band b = m_bands[m_nextBand++];
+		lock.unlock();
+
+		copy_band(b);
+
+		lock.lock();
+		if (--m_pendingBands == 0) {
+			m_done.notify_all();
+		}
+	}
+}
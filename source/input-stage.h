@@ -0,0 +1,75 @@
+/*
+ * AV1 Encoder for Open Broadcaster Software Studio
+ * Copyright (C) 2017 Michael Fabian Dirks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#pragma once
+#include "plugin.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#pragma warning(push)
+#pragma warning(disable:4201)
+#include <aom/aom.h>
+#pragma warning(pop)
+}
+
+/// Copies OBS frames into encoder images using a small worker pool.
+///
+/// Each plane is split into horizontal bands which are copied in parallel,
+/// allowing the caller to encode the previous image while the next one is
+/// being prepared. Without workers, frames are copied on the calling thread.
+class InputStage {
+	public:
+	InputStage(size_t workers);
+	~InputStage();
+
+	/// Start copying a frame into the image. Returns immediately if there are
+	/// workers, otherwise once the frame has been copied.
+	void submit(const struct encoder_frame *frame, aom_image_t *image);
+
+	/// Wait for the submitted frame to be copied completely.
+	void wait();
+
+	private:
+	struct band {
+		const uint8_t *source;
+		uint32_t sourceStride;
+		uint8_t *target;
+		uint32_t targetStride;
+		uint32_t width;
+		uint32_t rows;
+	};
+
+	void add_plane(const uint8_t *source, uint32_t sourceStride,
+		uint8_t *target, uint32_t targetStride, uint32_t width, uint32_t rows);
+	static void copy_band(const band &b);
+	void worker();
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	std::vector<band> m_bands;
+	size_t m_nextBand;
+	size_t m_pendingBands;
+	bool m_shutdown;
+};
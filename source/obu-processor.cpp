@@ -0,0 +1,365 @@
+/*
+ * AV1 Encoder for Open Broadcaster Software Studio
+ * Copyright (C) 2017 Michael Fabian Dirks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "obu-processor.h"
+#include <memory.h>
+#include <utility>
+
+// OBU Types
+#define OBU_SEQUENCE_HEADER		1
+#define OBU_TEMPORAL_DELIMITER		2
+#define OBU_PADDING			15
+
+class BitReader {
+	public:
+	BitReader(const uint8_t *data, size_t size) : m_data(data), m_size(size), m_position(0) {}
+
+	bool read(uint32_t bits, uint32_t &value) {
+		value = 0;
+		for (uint32_t idx = 0; idx < bits; idx++) {
+			if ((m_position >> 3) >= m_size)
+				return false;
+			uint8_t byte = m_data[m_position >> 3];
+			value = (value << 1) | ((byte >> (7 - (m_position & 7))) & 1);
+			m_position++;
+		}
+		return true;
+	}
+
+	bool read_uvlc(uint32_t &value) {
+		uint32_t leadingZeros = 0;
+		for (uint32_t bit = 0; bit == 0; leadingZeros++) {
+			if (!read(1, bit))
+				return false;
+		}
+		leadingZeros--;
+		if (leadingZeros >= 32) {
+			value = UINT32_MAX;
+			return true;
+		}
+		if (!read(leadingZeros, value))
+			return false;
+		value += (1u << leadingZeros) - 1;
+		return true;
+	}
+
+	private:
+	const uint8_t *m_data;
+	size_t m_size;
+	size_t m_position;
+};
+
+static bool read_leb128(const uint8_t *data, size_t size, uint64_t &value, size_t &length) {
+	value = 0;
+	for (length = 0; length < 8; length++) {
+		if (length >= size)
+			return false;
+		value |= uint64_t(data[length] & 0x7F) << (length * 7);
+		if (!(data[length] & 0x80)) {
+			length++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void write_leb128(std::vector<uint8_t> &buffer, uint64_t value) {
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		buffer.push_back(byte | (value ? 0x80 : 0x00));
+	} while (value);
+}
+
+OBUProcessor::OBUProcessor() : m_sequenceHeaderChanged(false) {}
+
+OBUProcessor::~OBUProcessor() {}
+
+bool OBUProcessor::process(const uint8_t *data, size_t size) {
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	m_packet.clear();
+	m_packet.reserve(size);
+	m_sequenceHeaderChanged = false;
+
+	for (size_t pos = 0; pos < size;) {
+		// OBU Header
+		uint8_t header = data[pos];
+		if (header & 0x80)
+			return false;
+		uint8_t type = (header >> 3) & 0x0F;
+		size_t headerSize = (header & 0x04) ? 2 : 1;
+		if (pos + headerSize > size)
+			return false;
+		uint64_t payloadSize = 0;
+		if (header & 0x02) {
+			size_t length = 0;
+			if (!read_leb128(data + pos + headerSize, size - pos - headerSize, payloadSize, length))
+				return false;
+			headerSize += length;
+		} else {
+			payloadSize = size - pos - headerSize;
+		}
+		if (payloadSize > size - pos - headerSize)
+			return false;
+
+		const uint8_t *obu = data + pos;
+		const uint8_t *payload = obu + headerSize;
+		size_t obuSize = headerSize + size_t(payloadSize);
+		pos += obuSize;
+
+		switch (type) {
+			case OBU_TEMPORAL_DELIMITER:
+			case OBU_PADDING:
+				// Redundant for muxers, drop them.
+				continue;
+			case OBU_SEQUENCE_HEADER:
+				if ((m_sequenceHeader.size() != payloadSize)
+					|| (memcmp(m_sequenceHeader.data(), payload, size_t(payloadSize)) != 0)) {
+					bool hadSequenceHeader = !m_sequenceHeader.empty();
+					if (!parse_sequence_header(payload, size_t(payloadSize)))
+						return false;
+					m_sequenceHeaderChanged = hadSequenceHeader;
+				}
+				break;
+		}
+
+		m_packet.insert(m_packet.end(), obu, obu + obuSize);
+	}
+
+	return true;
+}
+
+const uint8_t * OBUProcessor::get_data() {
+	return m_packet.data();
+}
+
+size_t OBUProcessor::get_size() {
+	return m_packet.size();
+}
+
+bool OBUProcessor::has_sequence_header_changed() {
+	return m_sequenceHeaderChanged;
+}
+
+bool OBUProcessor::set_sequence_header(const uint8_t *data, size_t size) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (size < 1)
+		return false;
+
+	uint8_t header = data[0];
+	if ((header & 0x80) || (((header >> 3) & 0x0F) != OBU_SEQUENCE_HEADER))
+		return false;
+
+	size_t headerSize = (header & 0x04) ? 2 : 1;
+	if (headerSize > size)
+		return false;
+	uint64_t payloadSize = 0;
+	if (header & 0x02) {
+		size_t length = 0;
+		if (!read_leb128(data + headerSize, size - headerSize, payloadSize, length))
+			return false;
+		headerSize += length;
+	} else {
+		payloadSize = size - headerSize;
+	}
+	if (payloadSize > size - headerSize)
+		return false;
+
+	return parse_sequence_header(data + headerSize, size_t(payloadSize));
+}
+
+void OBUProcessor::set_extra_data(const uint8_t *data, size_t size) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_extraData.emplace_back(data, data + size);
+}
+
+bool OBUProcessor::get_extra_data(uint8_t **data, size_t *size) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	if (m_extraData.empty())
+		return false;
+
+	*data = m_extraData.back().data();
+	*size = m_extraData.back().size();
+	return true;
+}
+
+bool OBUProcessor::parse_sequence_header(const uint8_t *payload, size_t size) {
+	BitReader br(payload, size);
+	uint32_t v = 0;
+
+	uint32_t seqProfile = 0, reducedStillPictureHeader = 0;
+	uint32_t seqLevelIdx = 0, seqTier = 0;
+	if (!br.read(3, seqProfile) || !br.read(1, v) || !br.read(1, reducedStillPictureHeader))
+		return false;
+
+	if (reducedStillPictureHeader) {
+		if (!br.read(5, seqLevelIdx))
+			return false;
+	} else {
+		uint32_t timingInfoPresent = 0, decoderModelInfoPresent = 0;
+		uint32_t initialDisplayDelayPresent = 0, operatingPoints = 0;
+		uint32_t bufferDelayLength = 0;
+
+		if (!br.read(1, timingInfoPresent))
+			return false;
+		if (timingInfoPresent) {
+			uint32_t equalPictureInterval = 0;
+			if (!br.read(32, v) || !br.read(32, v) || !br.read(1, equalPictureInterval))
+				return false;
+			if (equalPictureInterval && !br.read_uvlc(v))
+				return false;
+			if (!br.read(1, decoderModelInfoPresent))
+				return false;
+			if (decoderModelInfoPresent) {
+				if (!br.read(5, bufferDelayLength) || !br.read(32, v) || !br.read(5, v) || !br.read(5, v))
+					return false;
+				bufferDelayLength++;
+			}
+		}
+		if (!br.read(1, initialDisplayDelayPresent) || !br.read(5, operatingPoints))
+			return false;
+		for (uint32_t op = 0; op <= operatingPoints; op++) {
+			uint32_t level = 0, tier = 0;
+			if (!br.read(12, v) || !br.read(5, level))
+				return false;
+			if ((level > 7) && !br.read(1, tier))
+				return false;
+			if (decoderModelInfoPresent) {
+				uint32_t decoderModelPresent = 0;
+				if (!br.read(1, decoderModelPresent))
+					return false;
+				if (decoderModelPresent) {
+					if (!br.read(bufferDelayLength, v) || !br.read(bufferDelayLength, v) || !br.read(1, v))
+						return false;
+				}
+			}
+			if (initialDisplayDelayPresent) {
+				uint32_t displayDelayPresent = 0;
+				if (!br.read(1, displayDelayPresent))
+					return false;
+				if (displayDelayPresent && !br.read(4, v))
+					return false;
+			}
+			if (op == 0) {
+				seqLevelIdx = level;
+				seqTier = tier;
+			}
+		}
+	}
+
+	// Frame Size
+	uint32_t widthBits = 0, heightBits = 0;
+	if (!br.read(4, widthBits) || !br.read(4, heightBits)
+		|| !br.read(widthBits + 1, v) || !br.read(heightBits + 1, v))
+		return false;
+
+	// Tools
+	if (!reducedStillPictureHeader) {
+		uint32_t frameIdNumbersPresent = 0;
+		if (!br.read(1, frameIdNumbersPresent))
+			return false;
+		if (frameIdNumbersPresent && (!br.read(4, v) || !br.read(3, v)))
+			return false;
+	}
+	if (!br.read(3, v))
+		return false;
+	if (!reducedStillPictureHeader) {
+		uint32_t enableOrderHint = 0, chooseScreenContentTools = 0, forceScreenContentTools = 2;
+		if (!br.read(4, v) || !br.read(1, enableOrderHint))
+			return false;
+		if (enableOrderHint && !br.read(2, v))
+			return false;
+		if (!br.read(1, chooseScreenContentTools))
+			return false;
+		if (!chooseScreenContentTools && !br.read(1, forceScreenContentTools))
+			return false;
+		if (forceScreenContentTools > 0) {
+			uint32_t chooseIntegerMv = 0;
+			if (!br.read(1, chooseIntegerMv))
+				return false;
+			if (!chooseIntegerMv && !br.read(1, v))
+				return false;
+		}
+		if (enableOrderHint && !br.read(3, v))
+			return false;
+	}
+	if (!br.read(3, v))
+		return false;
+
+	// Color Config
+	uint32_t highBitdepth = 0, twelveBit = 0, monochrome = 0;
+	uint32_t colorDescriptionPresent = 0;
+	uint32_t colorPrimaries = 2, transferCharacteristics = 2, matrixCoefficients = 2;
+	uint32_t subsamplingX = 1, subsamplingY = 1, chromaSamplePosition = 0;
+	if (!br.read(1, highBitdepth))
+		return false;
+	if ((seqProfile == 2) && highBitdepth && !br.read(1, twelveBit))
+		return false;
+	if ((seqProfile != 1) && !br.read(1, monochrome))
+		return false;
+	if (!br.read(1, colorDescriptionPresent))
+		return false;
+	if (colorDescriptionPresent) {
+		if (!br.read(8, colorPrimaries) || !br.read(8, transferCharacteristics) || !br.read(8, matrixCoefficients))
+			return false;
+	}
+	if (monochrome) {
+		if (!br.read(1, v))
+			return false;
+	} else if ((colorPrimaries == 1) && (transferCharacteristics == 13) && (matrixCoefficients == 0)) {
+		subsamplingX = subsamplingY = 0;
+	} else {
+		if (!br.read(1, v))
+			return false;
+		if (seqProfile == 0) {
+			subsamplingX = subsamplingY = 1;
+		} else if (seqProfile == 1) {
+			subsamplingX = subsamplingY = 0;
+		} else if (twelveBit) {
+			if (!br.read(1, subsamplingX))
+				return false;
+			subsamplingY = 0;
+			if (subsamplingX && !br.read(1, subsamplingY))
+				return false;
+		} else {
+			subsamplingX = 1;
+			subsamplingY = 0;
+		}
+		if (subsamplingX && subsamplingY && !br.read(2, chromaSamplePosition))
+			return false;
+	}
+
+	// Cache the sequence header and build the av1C configuration record.
+	m_sequenceHeader.assign(payload, payload + size);
+
+	// Build into a new record, previously handed out ones must stay valid.
+	std::vector<uint8_t> record;
+	record.push_back(0x81); // Marker, Version 1
+	record.push_back(uint8_t((seqProfile << 5) | seqLevelIdx));
+	record.push_back(uint8_t((seqTier << 7) | (highBitdepth << 6) | (twelveBit << 5)
+		| (monochrome << 4) | (subsamplingX << 3) | (subsamplingY << 2) | chromaSamplePosition));
+	record.push_back(0x00); // No initial presentation delay.
+	record.push_back((OBU_SEQUENCE_HEADER << 3) | 0x02);
+	write_leb128(record, size);
+	record.insert(record.end(), payload, payload + size);
+	m_extraData.push_back(std::move(record));
+
+	return true;
+}
@@ -0,0 +1,68 @@
+/*
+ * AV1 Encoder for Open Broadcaster Software Studio
+ * Copyright (C) 2017 Michael Fabian Dirks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+#include <list>
+#include <mutex>
+#include <vector>
+
+/// Post-processes packets emitted by libaom before they are handed to OBS.
+///
+/// Temporal delimiter and padding OBUs are stripped and the most recent
+/// sequence header is cached so that an av1C configuration record can be handed to muxers as extra data.
+/// Records handed out stay valid for the lifetime of the processor.
+class OBUProcessor {
+	public:
+	OBUProcessor();
+	~OBUProcessor();
+
+	/// Process an encoded packet, returns false if the packet is malformed.
+	bool process(const uint8_t *data, size_t size);
+
+	/// Processed packet, valid until the next call to process().
+	const uint8_t *get_data();
+	size_t get_size();
+
+	/// True if the last processed packet replaced a previously known
+	/// sequence header.
+	bool has_sequence_header_changed();
+
+	/// Parse a standalone sequence header OBU, e.g. from global headers.
+	bool set_sequence_header(const uint8_t *data, size_t size);
+
+	/// Use data as-is as extra data, if no sequence header could be parsed.
+	void set_extra_data(const uint8_t *data, size_t size);
+
+	/// Retrieve the most recent extra data, if any is known.
+	bool get_extra_data(uint8_t **data, size_t *size);
+
+	private:
+	bool parse_sequence_header(const uint8_t *payload, size_t size);
+
+	// Extra data may be queried from another thread while encoding.
+	std::mutex m_lock;
+
+	std::vector<uint8_t> m_packet;
+	std::vector<uint8_t> m_sequenceHeader;
+	std::list<std::vector<uint8_t>> m_extraData;
+
+	bool m_sequenceHeaderChanged;
+};
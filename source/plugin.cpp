@@ -19,9 +19,15 @@
 
 #include "plugin.h"
 #include "av1-encoder.h"
+#include "cpu-budget.h"
 
 #include "libobs/obs-module.h"
 
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 OBS_DECLARE_MODULE();
 OBS_MODULE_AUTHOR("Michael Fabian Dirks");
 OBS_MODULE_USE_DEFAULT_LOCALE("enc-aomedia-av1", "en-US");
@@ -53,6 +59,81 @@ MODULE_EXPORT bool obs_module_load(void) {
 
 MODULE_EXPORT void obs_module_unload(void) {}
 
+#pragma region CPU Budget
+static std::mutex g_cpuBudgetLock;
+static std::vector<cpu_budget_client*> g_cpuBudgetClients;
+
+static void cpu_budget_rebalance() {
+	// The smallest requested budget wins, unset ones use all logical cores.
+	uint32_t limit = 0;
+	for (cpu_budget_client* client : g_cpuBudgetClients) {
+		if ((client->limit != 0) && ((limit == 0) || (client->limit < limit)))
+			limit = client->limit;
+	}
+	if (limit == 0) {
+		limit = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	// Helper threads and fixed clients take their share first, automatic
+	// ones split the rest.
+	uint32_t remaining = limit;
+	uint64_t totalWeight = 0;
+	std::vector<cpu_budget_client*> automatic;
+	for (cpu_budget_client* client : g_cpuBudgetClients) {
+		// Helper threads mostly wait, so reserve at most a single core.
+		remaining -= std::min(remaining, std::min(client->helpers, 1u));
+		if (client->fixed != 0) {
+			client->threads = client->fixed;
+			remaining -= std::min(remaining, client->fixed);
+		} else {
+			totalWeight += std::max(client->weight, uint64_t(1));
+			automatic.push_back(client);
+		}
+	}
+	if (automatic.empty())
+		return;
+
+	// Split by weight, but never assign less than a single thread.
+	uint32_t assigned = 0;
+	for (cpu_budget_client* client : automatic) {
+		uint64_t weight = std::max(client->weight, uint64_t(1));
+		uint32_t threads = std::max(uint32_t(remaining * weight / totalWeight), 1u);
+		client->threads = threads;
+		assigned += threads;
+	}
+
+	// Hand out rounding leftovers to the heaviest clients.
+	std::sort(automatic.begin(), automatic.end(), [](cpu_budget_client* a, cpu_budget_client* b) {
+		return a->weight > b->weight;
+	});
+	for (size_t idx = 0; assigned < remaining; idx = (idx + 1) % automatic.size(), assigned++) {
+		automatic[idx]->threads++;
+	}
+}
+
+void cpu_budget_join(cpu_budget_client *client) {
+	std::unique_lock<std::mutex> lock(g_cpuBudgetLock);
+	g_cpuBudgetClients.push_back(client);
+	cpu_budget_rebalance();
+}
+
+void cpu_budget_leave(cpu_budget_client *client) {
+	std::unique_lock<std::mutex> lock(g_cpuBudgetLock);
+	auto it = std::find(g_cpuBudgetClients.begin(), g_cpuBudgetClients.end(), client);
+	if (it == g_cpuBudgetClients.end())
+		return;
+	g_cpuBudgetClients.erase(it);
+	cpu_budget_rebalance();
+}
+
+void cpu_budget_update(cpu_budget_client *client, uint32_t fixed, uint32_t limit) {
+	std::unique_lock<std::mutex> lock(g_cpuBudgetLock);
+	client->fixed = fixed;
+	client->limit = limit;
+	cpu_budget_rebalance();
+}
+#pragma endregion CPU Budget
+
 MODULE_EXPORT const char* obs_module_name() {
 	return PLUGIN_NAME;
 }
@@ -33,10 +33,12 @@
 
 #define P_USAGE					"Usage"
 #define P_THREADS				"Threads"
+#define P_THREADS_BUDGET			"Threads.Budget"
 #define P_PROFILE				"Profile"
 #define P_ERRORRESILIENT			"ErrorResilient"
 #define P_ERRORRESILIENT_PARTITION		"ErrorResilient.Partition"
 #define P_LAGINFRAMES				"LagInFrames"
+#define P_PIPELINE				"Pipeline"
 
 // Rate Control
 #define P_RC_DROPFRAMETHRESHOLD			"RateControl.DropFrameThreshold"
@@ -68,3 +70,5 @@
 /// Keyframe Mode
 #define P_KF_INTERVAL_MIN			"Keyframe.Interval.Min"
 #define P_KF_INTERVAL_MAX			"Keyframe.Interval.Max"
+/// Intra Refresh
+#define P_INTRAREFRESH				"IntraRefresh"